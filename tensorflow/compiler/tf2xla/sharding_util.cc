@@ -96,6 +96,27 @@ xla::StatusOr<absl::optional<xla::OpSharding>> ParseShardingFromDevice(
   return ParseShardingFromDevice(device_name, num_cores_per_replica, sharding);
 }
 
+xla::StatusOr<absl::optional<xla::OpSharding>> ParseShardingFromDevice(
+    const Node& node, int num_cores_per_replica, ShardingCache* cache) {
+  if (cache == nullptr || HasNodeAttr(node.def(), kShardingAttribute)) {
+    // An explicit _XlaSharding attr overrides the device string, so only the
+    // pure device-derived parse is cacheable.
+    return ParseShardingFromDevice(node, num_cores_per_replica);
+  }
+  const string& device_name = node.assigned_device_name().empty()
+                                  ? node.requested_device()
+                                  : node.assigned_device_name();
+  auto it = cache->find(device_name);
+  if (it != cache->end()) {
+    return it->second;
+  }
+  TF_ASSIGN_OR_RETURN(
+      absl::optional<xla::OpSharding> sharding,
+      ParseShardingFromDevice(device_name, num_cores_per_replica));
+  cache->emplace(device_name, sharding);
+  return sharding;
+}
+
 void SetShardingDeviceAssignmentFromNode(const Node& src, Node* dst) {
   string device_name = src.assigned_device_name();
   if (device_name.empty()) {
@@ -17,6 +17,7 @@ limitations under the License.
 
 #include <string>
 
+#include "absl/container/flat_hash_map.h"
 #include "tensorflow/compiler/xla/client/sharding_builder.h"
 #include "tensorflow/compiler/xla/status_macros.h"
 #include "tensorflow/core/graph/graph.h"
@@ -43,6 +44,19 @@ xla::StatusOr<absl::optional<xla::OpSharding>> ParseShardingFromDevice(
 xla::StatusOr<absl::optional<xla::OpSharding>> ParseShardingFromDevice(
     const NodeDef& node_def, int num_cores_per_replica);
 
+// Memo table for device-derived shardings, keyed by device name. A cache is
+// only valid for a fixed num_cores_per_replica.
+using ShardingCache =
+    absl::flat_hash_map<string, absl::optional<xla::OpSharding>>;
+
+// Same as above, but memoizes the parse of each distinct device string in
+// <cache>, for callers that parse shardings for many nodes. Nodes carrying an
+// explicit _XlaSharding attribute bypass the cache, since their sharding does
+// not depend on the device string alone. <cache> may be null, in which case
+// this is equivalent to the uncached overload.
+xla::StatusOr<absl::optional<xla::OpSharding>> ParseShardingFromDevice(
+    const Node& node, int num_cores_per_replica, ShardingCache* cache);
+
 void SetShardingDeviceAssignmentFromNode(const Node& src, Node* dst);
 
 }  // namespace tensorflow
@@ -14,6 +14,9 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow/compiler/tf2xla/sharding_util.h"
 
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/node_def_util.h"
+#include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/platform/test.h"
 
@@ -55,4 +58,62 @@ TEST(CoreUtilTest, ParseShardingFromDevice) {
   EXPECT_EQ(-1, core_from_sharding(parse_status.ValueOrDie()));
 }
 
+REGISTER_OP("ShardingUtilDummy").Output("o: float");
+
+TEST(CoreUtilTest, ParseShardingFromDeviceCached) {
+  Graph graph(OpRegistry::Global());
+
+  auto add_node = [&graph](const string& name, const string& device,
+                           const absl::optional<xla::OpSharding>& attr_value) {
+    NodeDef node_def;
+    TF_CHECK_OK(NodeDefBuilder(name, "ShardingUtilDummy").Finalize(&node_def));
+    if (attr_value.has_value()) {
+      AddNodeAttr("_XlaSharding", attr_value.value().SerializeAsString(),
+                  &node_def);
+    }
+    Status status;
+    Node* node = graph.AddNode(node_def, &status);
+    TF_CHECK_OK(status);
+    node->set_assigned_device_name(device);
+    return node;
+  };
+
+  auto core_from_sharding =
+      [](absl::optional<xla::OpSharding> sharding) -> int64 {
+    if (sharding.has_value() &&
+        sharding.value().type() ==
+            xla::OpSharding::Type::OpSharding_Type_MAXIMAL) {
+      return sharding.value().tile_assignment_devices(0);
+    } else {
+      return -1;
+    }
+  };
+
+  Node* core_node = add_node("a", "/device:A_REPLICATED_CORE:2", absl::nullopt);
+  Node* cpu_node = add_node("b", "/cpu:0", absl::nullopt);
+  // Same device as core_node, but an explicit _XlaSharding attr overrides it.
+  Node* attr_node = add_node("c", "/device:A_REPLICATED_CORE:2",
+                             xla::sharding_builder::AssignDevice(7));
+
+  // The cached overload agrees with the uncached one for device-derived
+  // shardings, both on a cache miss and on a subsequent hit.
+  ShardingCache cache;
+  for (Node* node : {core_node, cpu_node, core_node}) {
+    auto uncached = ParseShardingFromDevice(*node, 8);
+    auto cached = ParseShardingFromDevice(*node, 8, &cache);
+    TF_ASSERT_OK(uncached.status());
+    TF_ASSERT_OK(cached.status());
+    EXPECT_EQ(core_from_sharding(uncached.ValueOrDie()),
+              core_from_sharding(cached.ValueOrDie()));
+  }
+  EXPECT_EQ(2, cache.size());
+
+  // attr_node's device is already cached as core 2; if the attr did not bypass
+  // the cache the stale device-derived sharding would be returned.
+  auto attr_sharding = ParseShardingFromDevice(*attr_node, 8, &cache);
+  TF_ASSERT_OK(attr_sharding.status());
+  EXPECT_EQ(7, core_from_sharding(attr_sharding.ValueOrDie()));
+  EXPECT_EQ(2, cache.size());
+}
+
 }  // namespace tensorflow
@@ -22,6 +22,7 @@ limitations under the License.
 #include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "tensorflow/compiler/tf2xla/dump_graph.h"
@@ -65,7 +66,7 @@ typedef std::unordered_map<string, Node*> NodeMap;
 // point from a new _Arg node instead.
 Status AddArgNodes(Graph* graph, const NodeMap& node_map,
                    const protobuf::RepeatedPtrField<tf2xla::Feed>& feeds,
-                   const std::unordered_map<string, string>& feed_remapping) {
+                   const absl::flat_hash_map<string, string>& feed_remapping) {
   for (int arg_index = 0; arg_index < feeds.size(); ++arg_index) {
     const tf2xla::Feed& feed = feeds[arg_index];
     // All feeds have been replaced by placeholders.
@@ -154,7 +155,7 @@ Status AddRetvalNodes(Graph* graph, const NodeMap& node_map,
 // execution to know the input and output args for the generated function.
 Status RewriteAndPruneGraph(
     Graph* graph, const tf2xla::Config& config,
-    const std::unordered_map<string, string>& feed_remapping) {
+    const absl::flat_hash_map<string, string>& feed_remapping) {
   NodeMap node_map;
   for (Node* n : graph->nodes()) {
     node_map[n->name()] = n;
@@ -325,15 +326,18 @@ Status InitGraph(const GraphDef& graph_def, const tf2xla::Config& config,
   GraphDef first_copy_def = graph_def;
 
   // Maps from name:port of a feed to the name:port of the placeholder to use.
-  std::unordered_map<string, string> feed_remapping;
-  TF_RETURN_IF_ERROR(AddPlaceholdersForFeeds(config, g->op_registry(),
-                                             &feed_remapping, &first_copy_def));
+  absl::flat_hash_map<string, string> feed_remapping;
+  GraphDefIndex index(first_copy_def);
+  TF_RETURN_IF_ERROR(AddPlaceholdersForFeeds(
+      config, g->op_registry(), &feed_remapping, &first_copy_def, &index));
 
   // Prune the GraphDef first so that unknown ops that we aren't compiling get
-  // filtered out.
+  // filtered out. AddPlaceholdersForFeeds added placeholder nodes, so the
+  // index must be rebuilt before pruning against it.
+  index = GraphDefIndex(first_copy_def);
   GraphDef second_copy_def;
   TF_RETURN_IF_ERROR(
-      PruneGraphDefInto(config, first_copy_def, &second_copy_def));
+      PruneGraphDefInto(config, first_copy_def, &second_copy_def, &index));
 
   TF_RETURN_IF_ERROR(AddDefaultAttrsToGraphDef(
       &second_copy_def, *g->op_registry(), /*node_offset=*/0));
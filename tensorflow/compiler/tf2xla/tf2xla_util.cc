@@ -15,32 +15,42 @@ limitations under the License.
 
 #include "tensorflow/compiler/tf2xla/tf2xla_util.h"
 
-#include <queue>
+#include <algorithm>
 #include <random>
-#include <set>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/inlined_vector.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "tensorflow/compiler/tf2xla/sharding_util.h"
 #include "tensorflow/compiler/tf2xla/tf2xla.pb.h"
 #include "tensorflow/compiler/xla/xla_data.pb.h"
 #include "tensorflow/core/common_runtime/function.h"
 #include "tensorflow/core/framework/graph.pb.h"
-#include "tensorflow/core/framework/graph_def_util.h"
 #include "tensorflow/core/framework/graph_to_functiondef.h"
 #include "tensorflow/core/framework/node_def.pb.h"
-#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/node_def_util.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_shape.pb.h"
-#include "tensorflow/core/framework/versions.pb.h"
 #include "tensorflow/core/graph/tensor_id.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
 
 namespace tensorflow {
 
 namespace {
 
+// Below this many nodes the fixed cost of spinning up a thread pool outweighs
+// the per-node work of the parallelized passes.
+constexpr int kMinNodesToParallelize = 8192;
+
 Status ValidateTensorId(const tf2xla::TensorId& id) {
   if (id.node_name().empty()) {
     return errors::InvalidArgument("TensorId node_name must be non-empty");
@@ -52,7 +62,7 @@ Status ValidateTensorId(const tf2xla::TensorId& id) {
 }
 
 Status CheckNameDuplicates(const string& kind, const string& name,
-                           std::set<string>* names) {
+                           absl::flat_hash_set<string>* names) {
   if (!name.empty()) {
     if (!names->insert(name).second) {
       return errors::InvalidArgument("duplicate ", kind, " name: ", name);
@@ -62,12 +72,14 @@ Status CheckNameDuplicates(const string& kind, const string& name,
 }
 
 Status CheckFeedFetchNameConflicts(const string& kind,
-                                   const std::set<string>& names) {
+                                   const absl::flat_hash_set<string>& names) {
   // We don't allow the feeds or fetches to contain both "foo" and "foo_data",
   // since that will cause a collision in codegen symbols.
+  string name_data;
   for (const string& name : names) {
-    const string name_data(name + "_data");
-    if (names.find(name_data) != names.end()) {
+    name_data.assign(name);
+    name_data.append("_data");
+    if (names.contains(name_data)) {
       return errors::InvalidArgument("conflicting ", kind, " name: ", name,
                                      " and ", name_data);
     }
@@ -79,8 +91,16 @@ Status CheckFeedFetchNameConflicts(const string& kind,
 
 const char kXlaOutsideCompilationAttrName[] = "_xla_outside_compilation";
 
+GraphDefIndex::GraphDefIndex(const GraphDef& graph_def) {
+  by_name.reserve(graph_def.node_size());
+  for (int i = 0; i < graph_def.node_size(); ++i) {
+    const NodeDef& node = graph_def.node(i);
+    by_name[node.name()] = Entry{&node, i};
+  }
+}
+
 Status ValidateConfig(const tf2xla::Config& config) {
-  std::set<string> names;
+  absl::flat_hash_set<string> names;
   for (const tf2xla::Feed& feed : config.feed()) {
     TF_RETURN_IF_ERROR(ValidateTensorId(feed.id()));
     TF_RETURN_IF_ERROR(TensorShape::IsValidShape(feed.shape()));
@@ -101,65 +121,95 @@ Status ValidateConfig(const tf2xla::Config& config) {
 
 Status AddPlaceholdersForFeeds(
     const tf2xla::Config& config, const OpRegistryInterface* op_registry,
-    std::unordered_map<string, string>* feed_remapping, GraphDef* graph_def) {
+    absl::flat_hash_map<string, string>* feed_remapping, GraphDef* graph_def,
+    const GraphDefIndex* index) {
   struct PlaceholderInfo {
     const tf2xla::Feed* feed = nullptr;  // point to Feed in <config>.
     string placeholder_name;
     DataType data_type = DT_INVALID;
   };
 
-  // Put each fed tensor into a map by name:port. A map is used for determinism
-  // when creating placeholders (genrules want deterministic output).
-  std::map<string, PlaceholderInfo> placeholder_info;
-  for (int i = 0; i < config.feed_size(); ++i) {
-    const tf2xla::Feed* feed = &config.feed(i);
-    const string name_port = TensorIdToString(feed->id());
-    PlaceholderInfo& info = placeholder_info[name_port];
-    info.feed = feed;
-    info.placeholder_name = absl::StrCat("aot_feed_", feed->id().output_index(),
-                                         "/", feed->id().node_name());
-    (*feed_remapping)[name_port] = info.placeholder_name;
+  // Collect the fed tensors into a vector of ("name:port", info) pairs,
+  // deduplicated by key through a side hash index, then sort the vector once.
+  // All later loops iterate it contiguously in sorted order, which keeps
+  // placeholder creation deterministic (genrules want deterministic output).
+  using PlaceholderEntry = std::pair<string, PlaceholderInfo>;
+  std::vector<PlaceholderEntry> placeholder_info;
+  placeholder_info.reserve(config.feed_size());
+  feed_remapping->reserve(config.feed_size());
+  {
+    // The index's key views point into placeholder_info, so it must not
+    // outlive the sort below; the reserve above keeps the views stable while
+    // we populate.
+    absl::flat_hash_map<absl::string_view, size_t> feed_index;
+    feed_index.reserve(config.feed_size());
+    for (int i = 0; i < config.feed_size(); ++i) {
+      const tf2xla::Feed* feed = &config.feed(i);
+      string name_port = TensorIdToString(feed->id());
+      size_t entry_index;
+      auto it = feed_index.find(name_port);
+      if (it == feed_index.end()) {
+        entry_index = placeholder_info.size();
+        placeholder_info.emplace_back(std::move(name_port), PlaceholderInfo());
+        feed_index.emplace(placeholder_info.back().first, entry_index);
+      } else {
+        entry_index = it->second;
+      }
+      PlaceholderEntry& entry = placeholder_info[entry_index];
+      PlaceholderInfo& info = entry.second;
+      info.feed = feed;
+      // Build "aot_feed_<index>/<node_name>" directly into the stored field,
+      // reserving for the prefix and a short index so the appends never
+      // regrow (and duplicate feeds reuse the capacity).
+      string& placeholder_name = info.placeholder_name;
+      placeholder_name.clear();
+      placeholder_name.reserve(16 + feed->id().node_name().size());
+      absl::StrAppend(&placeholder_name, "aot_feed_",
+                      feed->id().output_index(), "/", feed->id().node_name());
+      (*feed_remapping)[entry.first] = placeholder_name;
+    }
   }
+  std::sort(placeholder_info.begin(), placeholder_info.end(),
+            [](const PlaceholderEntry& a, const PlaceholderEntry& b) {
+              return a.first < b.first;
+            });
 
   // Verify node exists and determine data type.
-  std::unordered_map<string, const NodeDef*> name_to_node;
-  for (int i = 0; i < graph_def->node_size(); ++i) {
-    name_to_node[graph_def->node(i).name()] = &graph_def->node(i);
+  absl::optional<GraphDefIndex> local_index;
+  if (index == nullptr) {
+    local_index.emplace(*graph_def);
+    index = &local_index.value();
   }
-  for (auto it = placeholder_info.begin(); it != placeholder_info.end(); ++it) {
-    PlaceholderInfo& info = it->second;
+  for (PlaceholderEntry& entry : placeholder_info) {
+    PlaceholderInfo& info = entry.second;
     const tf2xla::TensorId& feed_id = info.feed->id();
 
     // Find the existing node and determine data type.
-    auto node_it = name_to_node.find(feed_id.node_name());
-    if (node_it == name_to_node.end()) {
+    auto node_it = index->by_name.find(feed_id.node_name());
+    if (node_it == index->by_name.end()) {
       return errors::NotFound("Can't find feed node: ",
                               TensorIdToString(feed_id));
     }
-    const NodeDef* existing = node_it->second;
+    const NodeDef* existing = node_it->second.node;
 
     if (info.feed->type() != DT_INVALID) {
       info.data_type = info.feed->type();
     } else {
-      // Build the node in order to infer its type.
-
-      // Must first add default attrs as well, so do this in a copied GraphDef.
-      GraphDef gd;
-      *gd.mutable_versions() = graph_def->versions();
-      *gd.add_node() = *existing;
+      // Infer the type from the node's OpDef, with default attrs applied to a
+      // local copy of the node def; this avoids building a whole Graph just to
+      // read the output types.
+      const OpRegistrationData* op_reg_data;
+      TF_RETURN_IF_ERROR(op_registry->LookUp(existing->op(), &op_reg_data));
+      NodeDef node_def = *existing;
+      AddDefaultsToNodeDef(op_reg_data->op_def, &node_def);
+      DataTypeVector output_types;
       TF_RETURN_IF_ERROR(
-          AddDefaultAttrsToGraphDef(&gd, *op_registry, 0 /*node_offset*/));
-
-      // Now build the node from the copied node def.
-      Graph g(op_registry);
-      g.set_versions(graph_def->versions());
-      Status status;
-      Node* feed_node = g.AddNode(gd.node(0), &status);
-      TF_RETURN_IF_ERROR(status);
+          OutputTypesForNode(node_def, op_reg_data->op_def, &output_types));
 
-      if (info.feed->id().output_index() < feed_node->num_outputs()) {
+      if (info.feed->id().output_index() <
+          static_cast<int>(output_types.size())) {
         info.data_type =
-            BaseType(feed_node->output_type(info.feed->id().output_index()));
+            BaseType(output_types[info.feed->id().output_index()]);
       } else {
         return errors::InvalidArgument(
             "Invalid output_index ", info.feed->id().output_index(),
@@ -171,8 +221,8 @@ Status AddPlaceholdersForFeeds(
   // Create placeholders. Note that we could avoid creating a placeholder for
   // feeds which are already placeholders, but we omit that to avoid more cases
   // in this code.
-  for (auto it = placeholder_info.begin(); it != placeholder_info.end(); ++it) {
-    const PlaceholderInfo& info = it->second;
+  for (const PlaceholderEntry& entry : placeholder_info) {
+    const PlaceholderInfo& info = entry.second;
     NodeDef* d = graph_def->add_node();
     d->set_name(info.placeholder_name);
     d->set_op("PlaceholderV2");
@@ -182,80 +232,171 @@ Status AddPlaceholdersForFeeds(
   }
 
   // Rewrite references to the fed tensors to refer to the placeholder.
-  for (int i = 0; i < graph_def->node_size(); ++i) {
-    NodeDef* node_def = graph_def->mutable_node(i);
-    for (int j = 0; j < node_def->input_size(); ++j) {
-      auto id = ParseTensorName(node_def->input(j));
-      auto it = placeholder_info.find(id.ToString());
-      if (it != placeholder_info.end()) {
-        node_def->set_input(j, it->second.placeholder_name);
+  // Index the placeholder names by the "name:port" key of the fed tensor; the
+  // key views point into placeholder_info, which is no longer mutated.
+  absl::flat_hash_map<absl::string_view, const string*> feed_key_to_placeholder;
+  feed_key_to_placeholder.reserve(placeholder_info.size());
+  for (const PlaceholderEntry& entry : placeholder_info) {
+    feed_key_to_placeholder.emplace(entry.first,
+                                    &entry.second.placeholder_name);
+  }
+  // Each shard reuses one buffer for the lookup keys rather than allocating a
+  // fresh string per input; control inputs ("^name") can never match a feed
+  // and need no key.
+  const auto rewrite_nodes = [graph_def, &feed_key_to_placeholder](int64 begin,
+                                                                   int64 end) {
+    string key_buffer;
+    for (int64 i = begin; i < end; ++i) {
+      NodeDef* node_def = graph_def->mutable_node(static_cast<int>(i));
+      for (string& input : *node_def->mutable_input()) {
+        const TensorId id = ParseTensorName(input);
+        if (id.second == Graph::kControlSlot) continue;
+        key_buffer.clear();
+        absl::StrAppend(&key_buffer, id.first, ":", id.second);
+        auto it = feed_key_to_placeholder.find(key_buffer);
+        if (it != feed_key_to_placeholder.end()) {
+          // <id> views into <input>, but the parse was already copied into
+          // key_buffer, so overwriting the input here is safe.
+          input = *it->second;
+        }
       }
     }
+  };
+  if (graph_def->node_size() >= kMinNodesToParallelize) {
+    // Shards touch disjoint nodes and only read the shared lookup table, so
+    // no synchronization is needed.
+    thread::ThreadPool pool(Env::Default(), "tf2xla_feed_rewrite",
+                            port::NumSchedulableCPUs());
+    pool.ParallelFor(graph_def->node_size(), /*cost_per_unit=*/100,
+                     rewrite_nodes);
+  } else {
+    rewrite_nodes(0, graph_def->node_size());
   }
 
   return Status::OK();
 }
 
 Status PruneGraphDefInto(const tf2xla::Config& config, const GraphDef& in,
-                         GraphDef* out) {
+                         GraphDef* out, const GraphDefIndex* index) {
   *out = in;
   out->clear_node();
 
-  // Tensors needed for feeding.
-  std::set<std::pair<string, int>> feed_tensors;
+  // Tensors needed for feeding. The node-name views point into <config>.
+  // Configs typically have at most a few dozen feeds, where a linear scan of
+  // an inline array is cheaper per edge than hashing the node name; larger
+  // feed counts fall back to a hash set.
+  constexpr size_t kMaxLinearScanFeeds = 32;
+  absl::InlinedVector<std::pair<absl::string_view, int>, 16> feed_vector;
+  feed_vector.reserve(config.feed_size());
   for (const tf2xla::Feed& feed : config.feed()) {
-    feed_tensors.insert(
-        std::make_pair(feed.id().node_name(), feed.id().output_index()));
+    feed_vector.emplace_back(feed.id().node_name(), feed.id().output_index());
   }
-
-  // Maps node name to reachability.
-  std::unordered_map<string, std::pair<bool, const NodeDef*>> node_by_name;
-  for (const NodeDef& node : in.node()) {
-    node_by_name[node.name()] = std::pair<bool, const NodeDef*>(false, &node);
+  absl::flat_hash_set<std::pair<absl::string_view, int>> feed_set;
+  if (feed_vector.size() > kMaxLinearScanFeeds) {
+    feed_set.insert(feed_vector.begin(), feed_vector.end());
   }
+  const auto is_fed = [&feed_vector, &feed_set](absl::string_view name,
+                                                int index) {
+    if (!feed_set.empty()) {
+      return feed_set.contains(std::make_pair(name, index));
+    }
+    return std::find(feed_vector.begin(), feed_vector.end(),
+                     std::make_pair(name, index)) != feed_vector.end();
+  };
 
-  // Traverse.
-  std::queue<string> name_queue;
+  // Maps node name to the node; <in> is not mutated while we traverse it.
+  absl::optional<GraphDefIndex> local_index;
+  if (index == nullptr) {
+    local_index.emplace(in);
+    index = &local_index.value();
+  }
+  const auto& node_by_name = index->by_name;
+
+  // Reachability from the fetches, indexed by node position in <in>.
+  std::vector<uint8> keep(in.node_size(), 0);
+  int num_kept = 0;
+
+  // Traverse. Visit order is irrelevant for reachability, so a vector used as
+  // a LIFO stack avoids the deque machinery of std::queue. Nodes are marked
+  // reachable when pushed rather than when popped, so every node enters the
+  // worklist at most once and shared predecessors (diamonds) cost one hash
+  // lookup per incoming edge instead of a full re-expansion.
+  std::vector<const NodeDef*> worklist;
+  worklist.reserve(in.node_size());
   for (int i = 0; i < config.fetch_size(); ++i) {
-    name_queue.push(config.fetch(i).id().node_name());
-  }
-  while (!name_queue.empty()) {
-    const string name = name_queue.front();
-    name_queue.pop();
-
-    auto find_it = node_by_name.find(name);
+    const string& fetch_name = config.fetch(i).id().node_name();
+    auto find_it = node_by_name.find(fetch_name);
     if (find_it == node_by_name.end()) {
-      return errors::InvalidArgument("While pruning graph, node ", name,
+      return errors::InvalidArgument("While pruning graph, node ", fetch_name,
                                      " needed but not found in the graph.");
     }
-    auto& map_entry = find_it->second;
-    if (map_entry.first) {
-      continue;
+    const GraphDefIndex::Entry& entry = find_it->second;
+    if (!keep[entry.pos]) {
+      keep[entry.pos] = 1;
+      ++num_kept;
+      worklist.push_back(entry.node);
     }
-    map_entry.first = true;
-
-    // Push input nodes of the currently visited node to name_queue.
-    for (const string& in_edge : map_entry.second->input()) {
-      auto id = ParseTensorName(in_edge);
-      const string node_name = string(id.first);
-      if (feed_tensors.find(std::make_pair(node_name, id.second)) ==
-          feed_tensors.end()) {
-        name_queue.push(node_name);
-      } else {
+  }
+  while (!worklist.empty()) {
+    const NodeDef* node = worklist.back();
+    worklist.pop_back();
+
+    // Push unvisited input nodes of the currently visited node.
+    for (const string& in_edge : node->input()) {
+      // Each input is parsed exactly once; the result feeds both the
+      // fed-tensor probe and the node lookup. Control edges can never be fed
+      // (feeds have a non-negative output index), so they skip the probe.
+      const TensorId id = ParseTensorName(in_edge);
+      if (!feed_vector.empty() && id.second != Graph::kControlSlot &&
+          is_fed(id.first, id.second)) {
         // The input tensor is from an edge that is being fed. Therefore,
         // we skip recursing down that edge, to avoid requiring nodes that
-        // may not be needed (note that the input node may still be added
-        // to name_queue later if one of its output edges is not being fed).
+        // may not be needed (note that the input node may still be visited
+        // later if one of its output edges is not being fed).
+        continue;
+      }
+      auto find_it = node_by_name.find(id.first);
+      if (find_it == node_by_name.end()) {
+        return errors::InvalidArgument("While pruning graph, node ", id.first,
+                                       " needed but not found in the graph.");
+      }
+      const GraphDefIndex::Entry& entry = find_it->second;
+      if (!keep[entry.pos]) {
+        keep[entry.pos] = 1;
+        ++num_kept;
+        worklist.push_back(entry.node);
       }
     }
   }
 
   // Copy over, preserving order of original and only nodes that are reachable
-  // from the fetches.
-  out->mutable_node()->Reserve(in.node_size());
-  for (const NodeDef& node : in.node()) {
-    if (node_by_name[node.name()].first) {
-      *out->add_node() = node;
+  // from the fetches; no name lookups are needed.
+  out->mutable_node()->Reserve(num_kept);
+  if (num_kept >= kMinNodesToParallelize) {
+    // Map each surviving node to its output slot, pre-size the output, and
+    // copy in parallel; shards write disjoint pre-allocated slots.
+    std::vector<int> kept_pos;
+    kept_pos.reserve(num_kept);
+    for (int i = 0; i < in.node_size(); ++i) {
+      if (keep[i]) kept_pos.push_back(i);
+    }
+    for (int i = 0; i < num_kept; ++i) {
+      out->add_node();
+    }
+    thread::ThreadPool pool(Env::Default(), "tf2xla_prune_copy",
+                            port::NumSchedulableCPUs());
+    pool.ParallelFor(num_kept, /*cost_per_unit=*/500,
+                     [out, &in, &kept_pos](int64 begin, int64 end) {
+                       for (int64 k = begin; k < end; ++k) {
+                         *out->mutable_node(static_cast<int>(k)) =
+                             in.node(kept_pos[k]);
+                       }
+                     });
+  } else {
+    for (int i = 0; i < in.node_size(); ++i) {
+      if (keep[i]) {
+        *out->add_node() = in.node(i);
+      }
     }
   }
   return Status::OK();
@@ -265,7 +406,8 @@ string TensorIdToString(const tf2xla::TensorId& id) {
   return absl::StrCat(id.node_name(), ":", id.output_index());
 }
 
-Status SetNodeShardingFromNeighbors(Node* n, bool out_edges) {
+Status SetNodeShardingFromNeighbors(Node* n, bool out_edges,
+                                    ShardingCache* sharding_cache) {
   int core = -1;
   const Node* matching_node = nullptr;
   for (const Edge* edge : (out_edges ? n->out_edges() : n->in_edges())) {
@@ -275,7 +417,8 @@ Status SetNodeShardingFromNeighbors(Node* n, bool out_edges) {
         absl::optional<xla::OpSharding> sharding,
         ParseShardingFromDevice(
             *possible_match,
-            /*num_cores_per_replica=*/std::numeric_limits<int32>::max()));
+            /*num_cores_per_replica=*/std::numeric_limits<int32>::max(),
+            sharding_cache));
     if (sharding.has_value()) {
       TF_RET_CHECK(sharding.value().type() ==
                    xla::OpSharding::Type::OpSharding_Type_MAXIMAL);
@@ -324,22 +467,37 @@ uint32 GetXLARandomSeed() {
   // after an overflow. When seeded with zero, some XLA backends
   // can return all zeros instead of random numbers.
   static std::atomic<uint32> counter(InitialRandomSeed());
-  return counter.fetch_add(2);
+  // Each thread claims a batch of seeds from the shared counter at a time, so
+  // that threads requesting many seeds don't serialize on the atomic (or
+  // bounce its cache line). Batches keep the odd-seed invariant since the
+  // counter only ever advances by even amounts.
+  constexpr uint32 kSeedBatchSize = 1024;
+  thread_local uint32 tls_next = 0;
+  thread_local uint32 tls_end = 0;
+  if (tls_next == tls_end) {
+    tls_next = counter.fetch_add(2 * kSeedBatchSize, std::memory_order_relaxed);
+    tls_end = tls_next + 2 * kSeedBatchSize;
+  }
+  const uint32 seed = tls_next;
+  tls_next += 2;
+  return seed;
 }
 
 // TODO(b/77601805): add tests for associated function related stuff.
 bool HasAssociatedFunction(const NodeDef& node_def,
                            const FunctionLibraryDefinition* fld) {
-  if (fld->Contains(node_def.op())) {
-    return true;
-  }
-
+  // Check the gradient op first; a length + memcmp compare is cheaper than
+  // hashing the op name for the library probe.
   if (node_def.op() == FunctionLibraryDefinition::kGradientOp) {
     // Gradient op has "f" attr, which is set to the function we are getting
     // gradient for. We need to functionalize the gradient function.
     return true;
   }
 
+  if (fld->Contains(node_def.op())) {
+    return true;
+  }
+
   for (const auto& iter : node_def.attr()) {
     if (iter.second.has_func()) {
       return true;
@@ -354,13 +512,14 @@ std::vector<AssociatedFunctionInfo> GetAssociatedFunctions(
   std::vector<AssociatedFunctionInfo> results;
   const string& op = node.type_string();
   if (fld->Contains(op)) {
-    // This is a function call node.
-    AttrValueMap attrs(node.attrs().begin(), node.attrs().end());
-    results.emplace_back(AssociatedFunctionInfo::FunctionCall(op, attrs));
+    // This is a function call node. The freshly built attr map is moved into
+    // the info rather than deep-copied.
+    results.emplace_back(AssociatedFunctionInfo::FunctionCall(
+        op, AttrValueMap(node.attrs().begin(), node.attrs().end())));
   } else if (node.type_string() == FunctionLibraryDefinition::kGradientOp) {
     // This is a SymbolicGradient op.
-    AttrValueMap attrs(node.attrs().begin(), node.attrs().end());
-    results.emplace_back(AssociatedFunctionInfo::SymbolicGradient(op, attrs));
+    results.emplace_back(AssociatedFunctionInfo::SymbolicGradient(
+        op, AttrValueMap(node.attrs().begin(), node.attrs().end())));
   } else {
     // Collect all function attrs for the node.
     for (auto& iter : node.attrs()) {
@@ -381,33 +540,15 @@ Status RewriteAssociatedFunction(
     const string& rewritten_function_name) {
   switch (associated_function.type()) {
     case AssociatedFunctionInfo::kFunctionCallNode: {
-      // Change this node to call the new function.
-      NodeDefBuilder builder(node->name(), rewritten_function_name, fld);
-      for (auto attr : node->attrs()) {
-        builder.Attr(attr.first, attr.second);
-      }
-      for (int i = 0; i < node->num_inputs(); i++) {
-        Node* input_node;
-        TF_RETURN_IF_ERROR(node->input_node(i, &input_node));
-        builder.Input(input_node->name(), i, node->input_type(i));
-      }
-      builder.Device(node->assigned_device_name().empty()
-                         ? node->requested_device()
-                         : node->assigned_device_name());
-      NodeDef node_def;
-      TF_RETURN_IF_ERROR(builder.Finalize(&node_def));
-      Status s;
-      Node* new_node = graph->AddNode(node_def, &s);
-      TF_RETURN_IF_ERROR(s);
-      for (auto edge : node->in_edges()) {
-        graph->AddEdge(edge->src(), edge->src_output(), new_node,
-                       edge->dst_input());
-      }
-      for (auto edge : node->out_edges()) {
-        graph->AddEdge(new_node, edge->src_output(), edge->dst(),
-                       edge->dst_input());
+      // Change this node to call the new function. The node's NodeDef already
+      // carries its attrs and inputs, so clone it and just swap the op;
+      // ReplaceNode rewires the in/out edges for us.
+      NodeDef node_def = node->def();
+      node_def.set_op(rewritten_function_name);
+      if (!node->assigned_device_name().empty()) {
+        node_def.set_device(node->assigned_device_name());
       }
-      graph->RemoveNode(node);
+      TF_RETURN_IF_ERROR(ReplaceNode(graph, node, node_def).status());
       break;
     }
     case AssociatedFunctionInfo::kSymbolicGradient: {
@@ -451,13 +592,13 @@ Status CachedFunctionHandles::GetOrInstantiate(
   }
 
   TF_RETURN_IF_ERROR(flr_->Instantiate(func_name, attrs, handle));
-  handles_[canonicalized_name] = *handle;
+  handles_.emplace(std::move(canonicalized_name), *handle);
   return Status::OK();
 }
 
 Status CachedFunctionHandles::ReleaseAllHandles() {
   Status result;
-  for (auto iter : handles_) {
+  for (const auto& iter : handles_) {
     result.Update(flr_->ReleaseHandle(iter.second));
   }
   handles_.clear();
@@ -473,9 +614,12 @@ xla::StatusOr<Node*> ReplaceNode(Graph* g, Node* n, const NodeDef& node_def) {
   }
 
   // Record original node's output edges and remove them first. This is to avoid
-  // multiple producers for dst nodes' input.
-  std::vector<OutEdgeInfo> out_edge_info;
-  std::vector<const Edge*> out_edges;
+  // multiple producers for dst nodes' input. Typical fan-out is small, so the
+  // snapshots live in inline storage and cause no heap allocation.
+  absl::InlinedVector<OutEdgeInfo, 8> out_edge_info;
+  absl::InlinedVector<const Edge*, 8> out_edges;
+  out_edge_info.reserve(n->out_edges().size());
+  out_edges.reserve(n->out_edges().size());
   for (const Edge* edge : n->out_edges()) {
     out_edges.push_back(edge);
     out_edge_info.push_back(
@@ -16,9 +16,12 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_TF2XLA_TF2XLA_UTIL_H_
 #define TENSORFLOW_COMPILER_TF2XLA_TF2XLA_UTIL_H_
 
-#include <unordered_map>
+#include <utility>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "tensorflow/compiler/tf2xla/sharding_util.h"
 #include "tensorflow/compiler/tf2xla/tf2xla.pb.h"
 #include "tensorflow/compiler/xla/status_macros.h"
 #include "tensorflow/core/framework/graph.pb.h"
@@ -32,27 +35,51 @@ namespace tensorflow {
 // ValidateConfig returns OK iff config is valid.
 Status ValidateConfig(const tf2xla::Config& config);
 
+// An index of the nodes of a GraphDef by name, so that callers that run
+// several passes over the same GraphDef can build the name lookup table once.
+// The keys are views into the GraphDef, which must outlive the index; the
+// index must be rebuilt if nodes are added or renamed (in particular,
+// AddPlaceholdersForFeeds adds placeholder nodes).
+struct GraphDefIndex {
+  explicit GraphDefIndex(const GraphDef& graph_def);
+
+  struct Entry {
+    const NodeDef* node;
+    int pos;  // Position of the node in GraphDef::node().
+  };
+
+  // Maps node name to the node and its position. For duplicate names the last
+  // node wins.
+  absl::flat_hash_map<absl::string_view, Entry> by_name;
+};
+
 // Modifies <graph_def> to include placeholders for each fed tensor, and
 // update references to the fed tensors to refer to the placeholders.
 // The existing nodes referenced by the feeds are not removed or modified
 // (except where their input edges are modified by the replacement of other
-// feeds).
+// feeds). If <index> is non-null it must be an index of <graph_def>, and is
+// used instead of building one locally; it is stale after this call.
 Status AddPlaceholdersForFeeds(
     const tf2xla::Config& config, const OpRegistryInterface* op_registry,
-    std::unordered_map<string, string>* feed_remapping, GraphDef* graph_def);
+    absl::flat_hash_map<string, string>* feed_remapping, GraphDef* graph_def,
+    const GraphDefIndex* index = nullptr);
 
 // Returns in <out> a copy of <in>, pruned to only include fetches from
-// <config>.
+// <config>. If <index> is non-null it must be an index of <in>, and is used
+// instead of building one locally.
 Status PruneGraphDefInto(const tf2xla::Config& config, const GraphDef& in,
-                         GraphDef* out);
+                         GraphDef* out, const GraphDefIndex* index = nullptr);
 
 // Returns node:port for the given <id>.
 string TensorIdToString(const tf2xla::TensorId& id);
 
 // Updates the sharding of <n> based on the sharding of its neighbors.
 // If <out_edges> is true, outgoing edges from <n> are considered; else incoming
-// edges are considered.
-Status SetNodeShardingFromNeighbors(Node* n, bool out_edges);
+// edges are considered. If <sharding_cache> is non-null, device-string parses
+// are memoized in it across calls; callers that process many nodes should pass
+// one cache for the whole pass.
+Status SetNodeShardingFromNeighbors(Node* n, bool out_edges,
+                                    ShardingCache* sharding_cache = nullptr);
 
 // Add an allowed data type to the AttrConstraint with the given name.
 void AddDtypeToKernalDefConstraint(absl::string_view name, DataType dtype,
@@ -71,26 +98,30 @@ class AssociatedFunctionInfo {
     kSymbolicGradient = 2,
   };
 
-  // The function is an attr of the node.
+  // The function is an attr of the node. The attrs are taken by value so
+  // callers can move a freshly built map in without a deep copy.
   static AssociatedFunctionInfo FunctionAttr(const string& func_name,
-                                             const AttrValueMap& attrs,
+                                             AttrValueMap attrs,
                                              const string& attr_name) {
-    return AssociatedFunctionInfo(kFunctionAttr, func_name, attrs, attr_name);
+    return AssociatedFunctionInfo(kFunctionAttr, func_name, std::move(attrs),
+                                  attr_name);
   }
 
   // The node is a function call.
   static AssociatedFunctionInfo FunctionCall(const string& func_name,
-                                             const AttrValueMap& attrs) {
+                                             AttrValueMap attrs) {
     // attr_name will not be used in this case.
-    return AssociatedFunctionInfo(kFunctionCallNode, func_name, attrs,
+    return AssociatedFunctionInfo(kFunctionCallNode, func_name,
+                                  std::move(attrs),
                                   /*attr_name=*/"");
   }
 
   // The node is a SymbolicGradient op.
   static AssociatedFunctionInfo SymbolicGradient(const string& func_name,
-                                                 const AttrValueMap& attrs) {
+                                                 AttrValueMap attrs) {
     // attr_name will not be used in this case.
-    return AssociatedFunctionInfo(kSymbolicGradient, func_name, attrs,
+    return AssociatedFunctionInfo(kSymbolicGradient, func_name,
+                                  std::move(attrs),
                                   /*attr_name=*/"");
   }
 
@@ -104,10 +135,10 @@ class AssociatedFunctionInfo {
 
  private:
   AssociatedFunctionInfo(AssociatedFunctionType type, const string& func_name,
-                         const AttrValueMap& attrs, const string& attr_name)
+                         AttrValueMap attrs, const string& attr_name)
       : type_(type),
         func_name_(func_name),
-        attrs_(attrs),
+        attrs_(std::move(attrs)),
         attr_name_(attr_name) {}
 
   // Available for all instances.
@@ -164,7 +195,7 @@ class CachedFunctionHandles {
 
  private:
   FunctionLibraryRuntime* flr_;
-  std::map<string, FunctionLibraryRuntime::Handle> handles_;
+  absl::flat_hash_map<string, FunctionLibraryRuntime::Handle> handles_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(CachedFunctionHandles);
 };
@@ -212,6 +212,60 @@ TEST(PruneGraphDefInto, Basic) {
   EXPECT_EQ(def.DebugString(), copy.DebugString());
 }
 
+TEST(PruneGraphDefInto, ExplicitIndex) {
+  GraphDef def;
+  auto* n = def.add_node();
+  n->set_name("a");
+  n->add_input("b:0");
+  n = def.add_node();
+  n->set_name("b");
+  n = def.add_node();
+  n->set_name("unused");
+
+  GraphDefIndex index(def);
+  GraphDef copy;
+  TF_EXPECT_OK(PruneGraphDefInto(FetchesConfig({"a"}), def, &copy, &index));
+  ASSERT_EQ(2, copy.node_size());
+  EXPECT_EQ("a", copy.node(0).name());
+  EXPECT_EQ("b", copy.node(1).name());
+
+  // The same index serves repeated prunes of the same GraphDef.
+  copy.Clear();
+  TF_EXPECT_OK(PruneGraphDefInto(FetchesConfig({"b"}), def, &copy, &index));
+  ASSERT_EQ(1, copy.node_size());
+  EXPECT_EQ("b", copy.node(0).name());
+}
+
+TEST(PruneGraphDefInto, ManyFeeds) {
+  // Uses more feeds than the linear-scan threshold so that the hash-set
+  // membership path of the feed lookup is exercised as well.
+  GraphDef def;
+  tf2xla::Config config;
+  NodeDef* root = def.add_node();
+  root->set_name("root");
+  for (int i = 0; i < 40; ++i) {
+    const string name = absl::StrCat("fed_", i);
+    root->add_input(absl::StrCat(name, ":0"));
+    NodeDef* n = def.add_node();
+    n->set_name(name);
+    // Only reachable if a fed edge is incorrectly followed; the node does not
+    // exist, so the prune would then fail.
+    n->add_input("missing:0");
+    tf2xla::Feed* feed = config.add_feed();
+    feed->mutable_id()->set_node_name(name);
+    feed->set_name(absl::StrCat("feed_", i));
+  }
+  tf2xla::Fetch* fetch = config.add_fetch();
+  fetch->mutable_id()->set_node_name("root");
+  fetch->set_name("fetch_root");
+
+  // Every input of root is fed, so nothing beyond root is required.
+  GraphDef copy;
+  TF_EXPECT_OK(PruneGraphDefInto(config, def, &copy));
+  ASSERT_EQ(1, copy.node_size());
+  EXPECT_EQ("root", copy.node(0).name());
+}
+
 TEST(SetNodeShardingFromNeighbors, Basic) {
   // Builds a graph that adds two Tensors.
   Scope scope = Scope::NewRootScope().ExitOnError();
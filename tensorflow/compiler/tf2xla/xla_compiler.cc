@@ -211,16 +211,21 @@ Status XlaCompiler::CompileFunction(const XlaCompiler::CompileOptions& options,
   // Attempt to assign a core to each _Retval and _Arg. Chooses the
   // lowest-numbered core that consumes the argument. We choose the
   // lowest-numbered core so the assignment is deterministic.
+  // Many neighbors share a device string, so memoize the device parses for
+  // the duration of the two loops.
+  ShardingCache sharding_cache;
   for (Node* n : graph->nodes()) {
     if (absl::string_view(n->type_string()) == "_Arg") {
-      TF_RETURN_IF_ERROR(SetNodeShardingFromNeighbors(n, /*out_edges=*/true));
+      TF_RETURN_IF_ERROR(
+          SetNodeShardingFromNeighbors(n, /*out_edges=*/true, &sharding_cache));
     }
   }
   // Do _Retval as a second loop, in case the retval's input is an _Arg (which
   // may have gotten a device assignment from the first loop).
   for (Node* n : graph->nodes()) {
     if (absl::string_view(n->type_string()) == "_Retval") {
-      TF_RETURN_IF_ERROR(SetNodeShardingFromNeighbors(n, /*out_edges=*/false));
+      TF_RETURN_IF_ERROR(SetNodeShardingFromNeighbors(n, /*out_edges=*/false,
+                                                      &sharding_cache));
     }
   }
 